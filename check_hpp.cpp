@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "lib_tar.hpp"
+
+/**
+ * Checks of the C++ layer against check.tar, run by `make check`.
+ */
+
+static_assert(!std::is_copy_constructible_v<tar::Archive>);
+static_assert(!std::is_copy_assignable_v<tar::Archive>);
+static_assert(std::is_nothrow_move_constructible_v<tar::Archive>);
+static_assert(std::is_nothrow_move_assignable_v<tar::Archive>);
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static std::vector<std::string_view> listed(const tar::Archive &archive, std::string_view path) {
+    std::vector<std::string_view> paths;
+    for (std::string_view entry : archive.list(path)) {
+        paths.push_back(entry);
+    }
+    return paths;
+}
+
+static void check_move(const char *path) {
+    tar::Archive first(path);
+    int fd = first.fd();
+    CHECK(fd >= 0);
+
+    tar::Archive second = std::move(first);
+    CHECK(first.fd() == -1);
+    CHECK(second.fd() == fd);
+    CHECK(second.exists("dir/a"));
+
+    tar::Archive third(path);
+    third = std::move(second);
+    CHECK(second.fd() == -1);
+    CHECK(third.fd() == fd);
+    CHECK(third.is_symlink("link"));
+
+    bool thrown = false;
+    try {
+        tar::Archive missing("check.tar.missing");
+    } catch (const std::system_error &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+static void check_list(const tar::Archive &archive) {
+    std::vector<std::string_view> dir = listed(archive, "dir");
+    CHECK(dir.size() == 3);
+    CHECK(listed(archive, "dir/") == dir);
+    // A link to a directory stores "dir" while the directory entry is "dir/"
+    CHECK(listed(archive, "link") == dir);
+    if (dir.size() == 3) {
+        CHECK(dir[0].size() == 154 && dir[0].substr(0, 5) == "dir/L");
+        CHECK(dir[1] == "dir/a");
+        CHECK(dir[2] == "dir/sub/");
+    }
+    CHECK(listed(archive, "files").size() == 8);
+
+    // Iterators stay usable once the range they came from is gone
+    auto it = archive.list("dir").begin();
+    ++it;
+    CHECK(*it == "dir/a");
+    ++it;
+    CHECK(*it == "dir/sub/");
+    CHECK(archive.list("dir/a").empty());
+    CHECK(archive.list("missing").empty());
+}
+
+static void check_read(const tar::Archive &archive) {
+    std::uint8_t buffer[64];
+    std::size_t len = 0;
+    CHECK(archive.read_file("filelink", 10, tar::byte_span(buffer, sizeof(buffer)), len) == 0);
+    CHECK(len == 22 && std::memcmp(buffer, "dir/a, another needle\n", 22) == 0);
+
+    std::vector<std::uint8_t> small(4);
+    CHECK(archive.read_file("dir/a", 0, small, len) == 28);
+    CHECK(len == 4 && std::memcmp(small.data(), "need", 4) == 0);
+
+    CHECK(archive.read_file("dir/a", 32, tar::byte_span(buffer, sizeof(buffer)), len) == -2);
+    CHECK(archive.read_file("dir/", 0, tar::byte_span(buffer, sizeof(buffer)), len) == -1);
+    CHECK(archive.read_file("missing", 0, tar::byte_span(buffer, sizeof(buffer)), len) == -1);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::printf("Usage: %s check.tar\n", argv[0]);
+        return 1;
+    }
+
+    check_move(argv[1]);
+    tar::Archive archive(argv[1]);
+    check_list(archive);
+    check_read(archive);
+
+    if (failures > 0) {
+        std::printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
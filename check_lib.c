@@ -0,0 +1,581 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "lib_tar.h"
+
+/**
+ * Checks of the library against check.tar, run by `make check`.
+ */
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+struct match {
+    char path[256];
+    uint64_t offset;
+    size_t pattern;
+};
+
+struct matches {
+    struct match items[512];
+    size_t count;
+};
+
+static int collect(const char *path, uint64_t offset, size_t pattern, void *arg) {
+    struct matches *m = arg;
+    if (path == NULL || m->count == sizeof(m->items) / sizeof(m->items[0])) {
+        return 1;
+    }
+    struct match *item = &m->items[m->count++];
+    snprintf(item->path, sizeof(item->path), "%s", path);
+    item->offset = offset;
+    item->pattern = pattern;
+    return 0;
+}
+
+static int match_cmp(const void *a, const void *b) {
+    const struct match *ma = a;
+    const struct match *mb = b;
+    int cmp = strcmp(ma->path, mb->path);
+    if (cmp != 0) {
+        return cmp;
+    }
+    if (ma->offset != mb->offset) {
+        return ma->offset < mb->offset ? -1 : 1;
+    }
+    return (ma->pattern > mb->pattern) - (ma->pattern < mb->pattern);
+}
+
+// Every thread count, with or without an index, must report the same matches as a single thread
+static void check_grep_threads(int fd) {
+    const char *patterns[] = {"needle", "haystack"};
+    int threads[] = {1, 2, 3, 8, 0};
+    static struct matches reference, other;
+
+    tar_index_t index;
+    CHECK(tar_index_build(fd, &index) == 0);
+    tar_archive_t variants[] = {
+        { .tar_fd = fd },
+        { .tar_fd = fd, .index = &index },
+    };
+
+    reference.count = 0;
+    CHECK(tar_grep(&variants[0], patterns, 2, NULL, collect, &reference, 1) == 112);
+    CHECK(reference.count == 112);
+    qsort(reference.items, reference.count, sizeof(struct match), match_cmp);
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+            other.count = 0;
+            CHECK(tar_grep(&variants[v], patterns, 2, NULL, collect, &other, threads[t]) == (ssize_t) reference.count);
+            CHECK(other.count == reference.count);
+            qsort(other.items, other.count, sizeof(struct match), match_cmp);
+            for (size_t i = 0; i < other.count && i < reference.count; i++) {
+                CHECK(match_cmp(&other.items[i], &reference.items[i]) == 0);
+            }
+        }
+
+        other.count = 0;
+        CHECK(tar_grep(&variants[v], patterns, 1, "dir/", collect, &other, 0) == 3);
+        other.count = 0;
+        CHECK(tar_grep(&variants[v], patterns + 1, 1, "*.txt", collect, &other, 4) == 36);
+    }
+    tar_index_free(&index);
+}
+
+// Lookups must give the same answers with and without an index and a filter
+static void check_lookups(const tar_archive_t *archive) {
+    char long_path[256];
+    memcpy(long_path, "dir/", 4);
+    memset(long_path + 4, 'L', 150);
+    long_path[154] = '\0';
+
+    CHECK(tar_exists(archive, "dir/a"));
+    CHECK(tar_exists(archive, long_path));
+    CHECK(!tar_exists(archive, "dir/missing"));
+    CHECK(tar_is_dir(archive, "dir/"));
+    CHECK(!tar_is_dir(archive, "dir/a"));
+    CHECK(tar_is_file(archive, "files/f7.txt"));
+    CHECK(tar_is_symlink(archive, "link"));
+
+    uint8_t buffer[64];
+    size_t len = sizeof(buffer);
+    CHECK(tar_read_file(archive, "filelink", 10, buffer, &len) == 0);
+    CHECK(len == 22 && memcmp(buffer, "dir/a, another needle\n", 22) == 0);
+    len = 4;
+    CHECK(tar_read_file(archive, "dir/a", 0, buffer, &len) == 28);
+    len = sizeof(buffer);
+    CHECK(tar_read_file(archive, "dir/a", 32, buffer, &len) == -2);
+    CHECK(tar_read_file(archive, "dir/", 0, buffer, &len) == -1);
+
+    char *entries[8] = {NULL};
+    size_t no_entries = 8;
+    CHECK(tar_list(archive, "link", entries, &no_entries) == 1);
+    CHECK(no_entries == 3);
+    for (size_t i = 0; i < no_entries && i < 8; i++) {
+        free(entries[i]);
+    }
+}
+
+static void check_archive_variants(int fd) {
+    tar_index_t index;
+    tar_bloom_t bloom;
+    CHECK(tar_index_build(fd, &index) == 0);
+    CHECK(index.no_entries == 15);
+    CHECK(tar_bloom_build(fd, 0.01, 0, &bloom) == 0);
+
+    tar_archive_t variants[] = {
+        { .tar_fd = fd },
+        { .tar_fd = fd, .index = &index },
+        { .tar_fd = fd, .bloom = &bloom },
+        { .tar_fd = fd, .index = &index, .bloom = &bloom },
+    };
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        check_lookups(&variants[v]);
+    }
+
+    // The filter built from the index must hold the same bits as the one built from the archive
+    tar_bloom_t from_index;
+    CHECK(tar_bloom_build_from_index(&index, 0.01, 0, &from_index) == 0);
+    CHECK(from_index.no_bits == bloom.no_bits && from_index.no_hashes == bloom.no_hashes);
+    CHECK(memcmp(from_index.bits, bloom.bits, bloom.no_bits / 8) == 0);
+    tar_bloom_free(&from_index);
+
+    // A rate below 2^-64 asks for more hashes than allowed, the bits are sized for the clamped count
+    CHECK(tar_bloom_build_from_index(&index, 1e-30, 0, &from_index) == 0);
+    CHECK(from_index.no_hashes == 64);
+    CHECK(from_index.no_bits == 1408);   // 15 * 64 / ln(2) rounded up to a whole word
+    tar_bloom_free(&from_index);
+
+    tar_bloom_free(&bloom);
+    // A released filter must answer "maybe" instead of dividing by zero
+    CHECK(tar_bloom_may_contain(&bloom, "dir/a"));
+    tar_index_free(&index);
+}
+
+static int same_fingerprint(const tar_fingerprint_t *a, const tar_fingerprint_t *b) {
+    return a->archive_size == b->archive_size && a->no_entries == b->no_entries && a->header_hash == b->header_hash;
+}
+
+// A saved filter must load back unchanged for its own archive only, then answer misses without reading it
+static void check_bloom_persistence(int fd, FILE *other) {
+    tar_index_t index;
+    tar_bloom_t bloom;
+    tar_bloom_t loaded;
+    CHECK(tar_index_build(fd, &index) == 0);
+    CHECK(tar_bloom_build_from_index(&index, 0.01, 0, &bloom) == 0);
+
+    FILE *f = tmpfile();
+    if (f == NULL) {
+        perror("tmpfile");
+        failures++;
+        tar_bloom_free(&bloom);
+        tar_index_free(&index);
+        return;
+    }
+    int saved = fileno(f);
+    CHECK(tar_bloom_save(&bloom, saved) == 0);
+
+    // The number of bits is stored little-endian whatever the host
+    uint8_t header[16];
+    CHECK(pread(saved, header, sizeof(header), 0) == sizeof(header));
+    CHECK(memcmp(header, "TARBLOOM", 8) == 0);
+    CHECK(header[8] == (bloom.no_bits & 0xff) && header[9] == ((bloom.no_bits >> 8) & 0xff));
+
+    tar_archive_t scanned = { .tar_fd = fd };
+    tar_archive_t indexed = { .tar_fd = fd, .index = &index };
+    const tar_archive_t *archives[] = {&scanned, &indexed};
+    for (size_t a = 0; a < sizeof(archives) / sizeof(archives[0]); a++) {
+        lseek(saved, 0, SEEK_SET);
+        if (tar_bloom_load(saved, archives[a], &loaded) != 0) {
+            fprintf(stderr, "saved filter not loaded back\n");
+            failures++;
+            continue;
+        }
+        CHECK(loaded.no_bits == bloom.no_bits && loaded.no_hashes == bloom.no_hashes);
+        CHECK(memcmp(loaded.bits, bloom.bits, bloom.no_bits / 8) == 0);
+        CHECK(same_fingerprint(&loaded.fingerprint, &index.fingerprint));
+        tar_bloom_free(&loaded);
+    }
+
+    tar_archive_t other_archive = { .tar_fd = fileno(other) };
+    lseek(saved, 0, SEEK_SET);
+    CHECK(tar_bloom_load(saved, &other_archive, &loaded) == -2);
+
+    // A miss of the filter is answered without touching the descriptor
+    lseek(saved, 0, SEEK_SET);
+    CHECK(tar_bloom_load(saved, &scanned, &loaded) == 0);
+    char missing[32] = "";
+    for (int i = 0; i < 100 && missing[0] == '\0'; i++) {
+        snprintf(missing, sizeof(missing), "missing%d", i);
+        if (tar_bloom_may_contain(&loaded, missing)) {
+            missing[0] = '\0';
+        }
+    }
+    CHECK(missing[0] != '\0');
+    tar_archive_t blind = { .tar_fd = -1, .bloom = &loaded };
+    CHECK(!tar_exists(&blind, missing));
+    CHECK(!tar_is_file(&blind, missing));
+    tar_bloom_free(&loaded);
+
+    // A truncated filter is rejected
+    CHECK(ftruncate(saved, 64 + 8) == 0);
+    lseek(saved, 0, SEEK_SET);
+    CHECK(tar_bloom_load(saved, &scanned, &loaded) == -1);
+
+    fclose(f);
+    tar_bloom_free(&bloom);
+    tar_index_free(&index);
+}
+
+// Fills a ustar header, the name is truncated to its field and size_field is stored as-is
+static void init_header(tar_header_t *header, const char *name, char typeflag, const uint8_t *size_field) {
+    memset(header, 0, sizeof(*header));
+    strncpy(header->name, name, sizeof(header->name));
+    memcpy(header->size, size_field, sizeof(header->size));
+    header->typeflag = typeflag;
+    memcpy(header->magic, TMAGIC, TMAGLEN);
+    memcpy(header->version, TVERSION, TVERSLEN);
+}
+
+// Writes a header block, then data padded to whole blocks
+static void write_header(FILE *f, const tar_header_t *header, const char *data, size_t data_len) {
+    fwrite(header, sizeof(*header), 1, f);
+
+    uint8_t block[512] = {0};
+    for (size_t done = 0; done < data_len; done += sizeof(block)) {
+        size_t chunk = data_len - done < sizeof(block) ? data_len - done : sizeof(block);
+        memset(block, 0, sizeof(block));
+        memcpy(block, data + done, chunk);
+        fwrite(block, sizeof(block), 1, f);
+    }
+}
+
+static void write_member(FILE *f, const char *name, char typeflag, const uint8_t *size_field,
+                         const char *data, size_t data_len) {
+    tar_header_t header;
+    init_header(&header, name, typeflag, size_field);
+    write_header(f, &header, data, data_len);
+}
+
+static void write_octal_member(FILE *f, const char *name, char typeflag, const char *data, size_t data_len) {
+    uint8_t size_field[12];
+    snprintf((char *) size_field, sizeof(size_field), "%011o", (unsigned) data_len);
+    write_member(f, name, typeflag, size_field, data, data_len);
+}
+
+static void write_pax_member(FILE *f, const char *records) {
+    write_octal_member(f, "PaxHeader", XHDTYPE, records, strlen(records));
+    write_octal_member(f, "file", REGTYPE, NULL, 0);
+}
+
+// Writes a PAX extended header holding a single "<length> <key>=<value>\n" record
+static void write_pax_record(FILE *f, const char *key, const char *value) {
+    char record[512];
+    size_t body = strlen(key) + strlen(value) + 3;
+    size_t len = body + 1;
+    // The length counts its own digits
+    while (snprintf(NULL, 0, "%zu", len) + body != len) {
+        len++;
+    }
+    snprintf(record, sizeof(record), "%zu %s=%s\n", len, key, value);
+    write_octal_member(f, "PaxHeader", XHDTYPE, record, strlen(record));
+}
+
+// Expects the matches of one grep, sorted by offset, in a single member
+static void check_grep_offsets(const tar_archive_t *archive, const char **patterns, size_t no_patterns,
+                               const uint64_t *offsets, const size_t *which, size_t count) {
+    static struct matches found;
+    found.count = 0;
+    CHECK(tar_grep(archive, patterns, no_patterns, NULL, collect, &found, 1) == (ssize_t) count);
+    CHECK(found.count == count);
+    qsort(found.items, found.count, sizeof(struct match), match_cmp);
+    for (size_t i = 0; i < found.count && i < count; i++) {
+        CHECK(found.items[i].offset == offsets[i] && found.items[i].pattern == which[i]);
+    }
+}
+
+/*
+ * Members are read in chunks of 1 MiB, the last bytes of a chunk being carried over to the next.
+ * Matches across a chunk boundary must be found, and short patterns lying in the carried bytes
+ * must not be reported twice.
+ */
+static void check_grep_chunks(void) {
+    const size_t mib = 1 << 20;
+    const size_t size = 3 * mib;
+    char *data = malloc(size);
+    FILE *f = tmpfile();
+    if (data == NULL || f == NULL) {
+        perror("check_grep_chunks");
+        failures++;
+        free(data);
+        if (f != NULL) {
+            fclose(f);
+        }
+        return;
+    }
+    memset(data, '.', size);
+    memcpy(data + mib - 5, "ab", 2);           // In the bytes carried over after the first chunk
+    memcpy(data + mib - 3, "needle", 6);       // Across the first boundary
+    memcpy(data + 2 * mib - 1, "ab", 2);       // Across the second boundary, one byte on each side
+    memcpy(data + size - 6, "needle", 6);      // At the very end of the member
+
+    uint8_t size_field[12];
+    snprintf((char *) size_field, sizeof(size_field), "%011o", (unsigned) size);
+    write_member(f, "big", REGTYPE, size_field, data, size);
+    uint8_t end[1024] = {0};
+    fwrite(end, sizeof(end), 1, f);
+    fflush(f);
+    free(data);
+
+    tar_archive_t archive = { .tar_fd = fileno(f) };
+    const char *patterns[] = {"needle", "ab"};
+
+    const uint64_t needle_offsets[] = {mib - 3, size - 6};
+    const size_t needle_which[] = {0, 0};
+    check_grep_offsets(&archive, patterns, 1, needle_offsets, needle_which, 2);
+
+    const uint64_t ab_offsets[] = {mib - 5, 2 * mib - 1};
+    const size_t ab_which[] = {0, 0};
+    check_grep_offsets(&archive, patterns + 1, 1, ab_offsets, ab_which, 2);
+
+    const uint64_t both_offsets[] = {mib - 5, mib - 3, 2 * mib - 1, size - 6};
+    const size_t both_which[] = {1, 0, 1, 0};
+    check_grep_offsets(&archive, patterns, 2, both_offsets, both_which, 4);
+
+    fclose(f);
+}
+
+// Builds a one-member archive in a temporary file and expects the scanner to reject it
+static void check_rejected(const char *what, void (*build)(FILE *)) {
+    FILE *f = tmpfile();
+    if (f == NULL) {
+        perror("tmpfile");
+        failures++;
+        return;
+    }
+    build(f);
+    uint8_t end[1024] = {0};
+    fwrite(end, sizeof(end), 1, f);
+    fflush(f);
+
+    tar_index_t index;
+    if (tar_index_build(fileno(f), &index) != -1) {
+        fprintf(stderr, "malformed archive accepted: %s\n", what);
+        failures++;
+        tar_index_free(&index);
+    }
+    CHECK(!exists(fileno(f), "file"));
+    fclose(f);
+}
+
+static void build_pax_no_newline(FILE *f) {
+    write_pax_member(f, "7 path=");
+}
+
+static void build_pax_short_record(FILE *f) {
+    write_pax_member(f, "1 ");
+}
+
+static void build_pax_huge_size(FILE *f) {
+    write_pax_member(f, "29 size=18446744073709551615\n");
+}
+
+static void build_base256_overflow(FILE *f) {
+    uint8_t size_field[12];
+    memset(size_field, 0xff, sizeof(size_field));
+    size_field[0] = 0x80;
+    write_member(f, "file", REGTYPE, size_field, NULL, 0);
+}
+
+static void build_base256_near_max(FILE *f) {
+    uint8_t size_field[12] = {0x80, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf0};
+    write_member(f, "file", REGTYPE, size_field, NULL, 0);
+}
+
+// A one-member archive, different from check.tar
+static FILE *build_small_archive(void) {
+    FILE *f = tmpfile();
+    if (f == NULL) {
+        return NULL;
+    }
+    uint8_t size_field[12];
+    snprintf((char *) size_field, sizeof(size_field), "%011o", 4);
+    write_member(f, "file", REGTYPE, size_field, "data", 4);
+    uint8_t end[1024] = {0};
+    fwrite(end, sizeof(end), 1, f);
+    fflush(f);
+    return f;
+}
+
+#define BIG_SIZE ((8ULL << 30) + 5)
+
+static void expect_read(const tar_archive_t *archive, const char *path, uint64_t offset, const char *expected) {
+    uint8_t buffer[64];
+    size_t len = sizeof(buffer);
+    ssize_t ret = tar_read_file(archive, path, offset, buffer, &len);
+    if (ret != 0 || len != strlen(expected) || memcmp(buffer, expected, len) != 0) {
+        fprintf(stderr, "read of %s at %llu: got %zd, %zu bytes, expected \"%s\"\n",
+                path, (unsigned long long) offset, ret, len, expected);
+        failures++;
+    }
+}
+
+/*
+ * Builds an archive with the ways tar stores long paths, long link names and large sizes:
+ * a ustar prefix, GNU long names and long link names, a base-256 size over 8 GiB, and PAX
+ * size and linkpath records. The 8 GiB member is a hole in the temporary file.
+ */
+static FILE *build_formats(const char *long_name, const char *long_link) {
+    FILE *f = tmpfile();
+    if (f == NULL) {
+        return NULL;
+    }
+    tar_header_t header;
+    uint8_t size_field[12];
+
+    snprintf((char *) size_field, sizeof(size_field), "%011o", 8);
+    init_header(&header, "file.txt", REGTYPE, size_field);
+    memcpy(header.prefix, "some/deep/dir", strlen("some/deep/dir"));
+    write_header(f, &header, "prefixed", 8);
+
+    write_octal_member(f, "././@LongLink", GNUTYPE_LONGNAME, long_name, strlen(long_name) + 1);
+    write_octal_member(f, long_name, REGTYPE, "long name", 9);
+
+    write_octal_member(f, "././@LongLink", GNUTYPE_LONGNAME, long_link, strlen(long_link) + 1);
+    write_octal_member(f, "././@LongLink", GNUTYPE_LONGLINK, long_name, strlen(long_name) + 1);
+    init_header(&header, long_link, SYMTYPE, (const uint8_t *) "00000000000");
+    strncpy(header.linkname, long_name, sizeof(header.linkname));
+    write_header(f, &header, NULL, 0);
+
+    // Base-256: a marker byte then the size big-endian
+    memset(size_field, 0, sizeof(size_field));
+    size_field[0] = 0x80;
+    for (int i = 0; i < 8; i++) {
+        size_field[11 - i] = (uint8_t) (BIG_SIZE >> (8 * i));
+    }
+    init_header(&header, "big", REGTYPE, size_field);
+    fwrite(&header, sizeof(header), 1, f);
+    fseeko(f, BIG_SIZE - 5, SEEK_CUR);
+    uint8_t tail[512] = "TAIL!";
+    fwrite(tail, 512 - (BIG_SIZE - 5) % 512, 1, f);
+
+    write_pax_record(f, "size", "11");
+    write_member(f, "paxsized", REGTYPE, (const uint8_t *) "00000000000", "pax-sized!\n", 11);
+
+    write_pax_record(f, "linkpath", long_name);
+    init_header(&header, "paxlink", SYMTYPE, (const uint8_t *) "00000000000");
+    memcpy(header.linkname, "wrong", 5);
+    write_header(f, &header, NULL, 0);
+
+    write_octal_member(f, "after", REGTYPE, "after", 5);
+    uint8_t end[1024] = {0};
+    fwrite(end, sizeof(end), 1, f);
+    fflush(f);
+    return f;
+}
+
+static void check_formats(void) {
+    char long_name[201];
+    char long_link[157];
+    memcpy(long_name, "long/", 5);
+    memset(long_name + 5, 'n', 195);
+    long_name[200] = '\0';
+    memcpy(long_link, "glink/", 6);
+    memset(long_link + 6, 'k', 150);
+    long_link[156] = '\0';
+
+    FILE *f = build_formats(long_name, long_link);
+    if (f == NULL) {
+        perror("tmpfile");
+        failures++;
+        return;
+    }
+    tar_index_t index;
+    if (tar_index_build(fileno(f), &index) != 0) {
+        fprintf(stderr, "valid archive rejected\n");
+        failures++;
+        fclose(f);
+        return;
+    }
+    CHECK(index.no_entries == 7);
+    const tar_entry_t *big = tar_index_find(&index, "big", 3);
+    CHECK(big != NULL && big->size == BIG_SIZE);
+    const tar_entry_t *link = tar_index_find(&index, long_link, strlen(long_link));
+    CHECK(link != NULL && link->typeflag == SYMTYPE && strcmp(link->linkname, long_name) == 0);
+
+    tar_archive_t variants[] = {
+        { .tar_fd = fileno(f) },
+        { .tar_fd = fileno(f), .index = &index },
+    };
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        const tar_archive_t *archive = &variants[v];
+        expect_read(archive, "some/deep/dir/file.txt", 0, "prefixed");
+        expect_read(archive, long_name, 0, "long name");
+        CHECK(tar_is_symlink(archive, long_link));
+        expect_read(archive, long_link, 5, "name");
+        expect_read(archive, "big", BIG_SIZE - 5, "TAIL!");
+        uint8_t head[4];
+        size_t len = sizeof(head);
+        uint64_t left = BIG_SIZE - sizeof(head);
+        CHECK(tar_read_file(archive, "big", 0, head, &len) == (left > SSIZE_MAX ? SSIZE_MAX : (ssize_t) left));
+        expect_read(archive, "paxsized", 0, "pax-sized!\n");
+        expect_read(archive, "paxlink", 0, "long name");
+        expect_read(archive, "after", 0, "after");
+    }
+
+    tar_index_free(&index);
+    fclose(f);
+}
+
+static void check_malformed(void) {
+    check_rejected("PAX record without a newline", build_pax_no_newline);
+    check_rejected("PAX record shorter than its key", build_pax_short_record);
+    check_rejected("PAX size wrapping the archive offset", build_pax_huge_size);
+    check_rejected("base-256 size over 64 bits", build_base256_overflow);
+    check_rejected("base-256 size wrapping the archive offset", build_base256_near_max);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s check.tar\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd == -1) {
+        perror("open(tar_file)");
+        return 1;
+    }
+
+    check_grep_threads(fd);
+    check_grep_chunks();
+
+    FILE *small = build_small_archive();
+    if (small == NULL) {
+        perror("tmpfile");
+        return 1;
+    }
+    check_bloom_persistence(fd, small);
+    fclose(small);
+    check_archive_variants(fd);
+    check_formats();
+    check_malformed();
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
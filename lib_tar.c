@@ -1,9 +1,18 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
 #include "lib_tar.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <math.h>
+#include <sys/stat.h>
 #define TAR_CHECKSUM_SIZE 8
 #define TAR_MAGIC_OFFSET 257
 #define TAR_VERSION_OFFSET 263
@@ -12,49 +21,414 @@
 #define TAR_NAME_SIZE 100
 #define TAR_TYPEFLAG_OFFSET 156
 #define TAR_LINKNAME_OFFSET 157
+#define TAR_SIZE_OFFSET 124
+#define TAR_SIZE_SIZE 12
+#define TAR_PREFIX_OFFSET 345
+#define TAR_PREFIX_SIZE 155
+#define TAR_MAX_EXTENDED_SIZE (1 << 20)
+#define TAR_GREP_CHUNK (1 << 20)
+#define TAR_BLOOM_MAGIC "TARBLOOM"
+#define TAR_BLOOM_MAGIC_SIZE 8
+#define TAR_BLOOM_HEADER_SIZE 64
+#define TAR_BLOOM_MAX_HASHES 64
+
+static int is_null_block(const uint8_t *block) {
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
+        if (block[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
 
-/**
- * Checks whether an entry exists in the archive.
- *
- * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
- * @param path A path to an entry in the archive.
- *
- * @return zero if no entry at the given path exists in the archive,
- *         any other value otherwise.
+// Rounds a member size up to the space its data takes in the archive
+static uint64_t data_blocks_size(uint64_t size) {
+    return (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+}
+
+/*
+ * Decodes a numeric header field, in octal ASCII or in base-256 when the high bit of its first byte is set.
+ * Returns -1 if the value is negative or does not fit in 64 bits.
  */
-int exists(int tar_fd, char *path){
+static int parse_number(const uint8_t *field, size_t size, uint64_t *value) {
+    *value = 0;
+    if (field[0] & 0x80) {
+        // The second highest bit is the sign of the two's complement value
+        if (field[0] & 0x40) {
+            return -1;
+        }
+        *value = field[0] & 0x3f;
+        for (size_t i = 1; i < size; i++) {
+            if (*value >> 56 != 0) {
+                return -1;
+            }
+            *value = *value << 8 | field[i];
+        }
+        return 0;
+    }
 
-    uint8_t buffer[TAR_BLOCK_SIZE];
+    size_t i = 0;
+    while (i < size && field[i] == ' ') {
+        i++;
+    }
+    for (; i < size && field[i] >= '0' && field[i] <= '7'; i++) {
+        if (*value >> 61 != 0) {
+            return -1;
+        }
+        *value = *value << 3 | (uint64_t) (field[i] - '0');
+    }
+    return 0;
+}
 
-    // Go back to the beginning of the tar
-    if (lseek(tar_fd, 0, SEEK_SET) == -1) {
-        return 0;
+/*
+ * Header scanner state.
+ * The strings of the last entry returned live in path and linkname, the has_* flags
+ * tell that an extended header already set the matching value for the next entry.
+ */
+struct scan {
+    int tar_fd;
+    uint64_t pos;
+    // Running fingerprint of what was read so far
+    uint64_t no_entries;
+    uint64_t hash;
+    char *path;
+    size_t path_cap;
+    char *linkname;
+    size_t linkname_cap;
+    int has_path;
+    int has_linkname;
+    int has_size;
+    uint64_t size;
+};
+
+// FNV-1a, continued from a previous hash value
+static uint64_t fnv_fold(uint64_t h, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ bytes[i]) * 0x100000001b3ULL;
     }
+    return h;
+}
 
-    while (read(tar_fd, buffer, TAR_BLOCK_SIZE) == TAR_BLOCK_SIZE) {
+static void scan_init(struct scan *sc, int tar_fd) {
+    memset(sc, 0, sizeof(*sc));
+    sc->tar_fd = tar_fd;
+    sc->hash = 0xcbf29ce484222325ULL;
+}
 
-        int is_null_block = 1;
-        for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
-            if (buffer[i] != 0) {
-                is_null_block = 0;
-                break;
+// Moves past the data of a member, fails if its end does not fit in a file offset
+static int scan_skip(struct scan *sc, uint64_t data_offset, uint64_t size) {
+    if (size > (uint64_t) INT64_MAX - TAR_BLOCK_SIZE - data_offset) {
+        return -1;
+    }
+    sc->pos = data_offset + data_blocks_size(size);
+    return 0;
+}
+
+static void scan_free(struct scan *sc) {
+    free(sc->path);
+    free(sc->linkname);
+}
+
+// Copies len bytes and a null into a growable buffer
+static int scan_set(char **buffer, size_t *cap, const char *value, size_t len) {
+    if (len + 1 > *cap) {
+        char *grown = realloc(*buffer, len + 1);
+        if (grown == NULL) {
+            return -1;
+        }
+        *buffer = grown;
+        *cap = len + 1;
+    }
+    memcpy(*buffer, value, len);
+    (*buffer)[len] = '\0';
+    return 0;
+}
+
+// Reads the data of an extended header, null terminated
+static char *scan_read_data(struct scan *sc, uint64_t offset, uint64_t size) {
+    if (size > TAR_MAX_EXTENDED_SIZE) {
+        return NULL;
+    }
+    char *data = malloc(size + 1);
+    if (data == NULL) {
+        return NULL;
+    }
+    if (pread(sc->tar_fd, data, size, offset) != (ssize_t) size) {
+        free(data);
+        return NULL;
+    }
+    sc->hash = fnv_fold(sc->hash, data, size);
+    data[size] = '\0';
+    return data;
+}
+
+// Parses the "<length> <key>=<value>\n" records of a PAX extended header
+static int scan_pax(struct scan *sc, char *data, size_t size) {
+    char *cur = data;
+    char *end = data + size;
+
+    while (cur < end && *cur != '\0') {
+        char *space;
+        if (!isdigit((unsigned char) *cur)) {
+            return -1;
+        }
+        unsigned long long record_len = strtoull(cur, &space, 10);
+        if (*space != ' ' || record_len > (size_t) (end - cur)) {
+            return -1;
+        }
+        char *key = space + 1;
+        char *record_end = cur + record_len;
+        // The record must hold at least the key and end with a newline
+        if (record_end <= key || record_end[-1] != '\n') {
+            return -1;
+        }
+        char *equal = memchr(key, '=', record_end - 1 - key);
+        if (equal == NULL) {
+            return -1;
+        }
+        size_t key_len = equal - key;
+        char *value = equal + 1;
+        size_t value_len = record_end - 1 - value;
+
+        if (key_len == 4 && strncmp(key, "path", 4) == 0) {
+            if (scan_set(&sc->path, &sc->path_cap, value, value_len) != 0) {
+                return -1;
+            }
+            sc->has_path = 1;
+        } else if (key_len == 8 && strncmp(key, "linkpath", 8) == 0) {
+            if (scan_set(&sc->linkname, &sc->linkname_cap, value, value_len) != 0) {
+                return -1;
+            }
+            sc->has_linkname = 1;
+        } else if (key_len == 4 && strncmp(key, "size", 4) == 0) {
+            char *size_end;
+            errno = 0;
+            if (value_len == 0 || !isdigit((unsigned char) *value)) {
+                return -1;
+            }
+            sc->size = strtoull(value, &size_end, 10);
+            if (errno == ERANGE || size_end != value + value_len) {
+                return -1;
             }
+            sc->has_size = 1;
         }
-        if (is_null_block) {
-            break;
+        cur = record_end;
+    }
+    return 0;
+}
+
+/*
+ * Reads the next entry of the archive, decoding on the way the PAX ('x') and GNU long name
+ * ('L', 'K') headers that precede it, and the ustar prefix field. PAX global headers ('g')
+ * are skipped.
+ *
+ * Returns 1 if an entry was read, 0 at the end of the archive, -1 on error.
+ */
+static int scan_next(struct scan *sc, tar_entry_t *entry) {
+    uint8_t header[TAR_BLOCK_SIZE];
+
+    for (;;) {
+        if (pread(sc->tar_fd, header, TAR_BLOCK_SIZE, sc->pos) != TAR_BLOCK_SIZE || is_null_block(header)) {
+            return 0;
+        }
+        sc->hash = fnv_fold(sc->hash, header, TAR_BLOCK_SIZE);
+
+        char typeflag = header[TAR_TYPEFLAG_OFFSET];
+        uint64_t size;
+        uint64_t data_offset = sc->pos + TAR_BLOCK_SIZE;
+        if (parse_number(header + TAR_SIZE_OFFSET, TAR_SIZE_SIZE, &size) != 0) {
+            return -1;
+        }
+
+        if (typeflag == XHDTYPE || typeflag == XGLTYPE || typeflag == GNUTYPE_LONGNAME || typeflag == GNUTYPE_LONGLINK) {
+            if (scan_skip(sc, data_offset, size) != 0) {
+                return -1;
+            }
+            if (typeflag == XGLTYPE) {
+                continue;
+            }
+
+            char *data = scan_read_data(sc, data_offset, size);
+            if (data == NULL) {
+                return -1;
+            }
+            int ret;
+            if (typeflag == XHDTYPE) {
+                ret = scan_pax(sc, data, size);
+            } else if (typeflag == GNUTYPE_LONGNAME) {
+                ret = scan_set(&sc->path, &sc->path_cap, data, strlen(data));
+                sc->has_path = 1;
+            } else {
+                ret = scan_set(&sc->linkname, &sc->linkname_cap, data, strlen(data));
+                sc->has_linkname = 1;
+            }
+            free(data);
+            if (ret != 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        if (sc->has_size) {
+            size = sc->size;
+        }
+
+        if (!sc->has_path) {
+            const char *name = (const char *) header;
+            const char *prefix = (const char *) header + TAR_PREFIX_OFFSET;
+            size_t name_len = strnlen(name, TAR_NAME_SIZE);
+            size_t prefix_len = 0;
+            // Only POSIX ustar headers have a prefix, GNU ones store other fields there
+            if (memcmp(header + TAR_MAGIC_OFFSET, TMAGIC, TMAGLEN) == 0) {
+                prefix_len = strnlen(prefix, TAR_PREFIX_SIZE);
+            }
+
+            char full[TAR_PREFIX_SIZE + 1 + TAR_NAME_SIZE];
+            size_t full_len = 0;
+            if (prefix_len > 0) {
+                memcpy(full, prefix, prefix_len);
+                full[prefix_len] = '/';
+                full_len = prefix_len + 1;
+            }
+            memcpy(full + full_len, name, name_len);
+            full_len += name_len;
+            if (scan_set(&sc->path, &sc->path_cap, full, full_len) != 0) {
+                return -1;
+            }
+        }
+
+        if (!sc->has_linkname) {
+            const char *linkname = (const char *) header + TAR_LINKNAME_OFFSET;
+            if (scan_set(&sc->linkname, &sc->linkname_cap, linkname, strnlen(linkname, TAR_NAME_SIZE)) != 0) {
+                return -1;
+            }
+        }
+
+        entry->path = sc->path;
+        entry->path_len = strlen(sc->path);
+        entry->linkname = sc->linkname;
+        entry->typeflag = typeflag;
+        entry->size = size;
+        entry->data_offset = data_offset;
+
+        if (scan_skip(sc, data_offset, size) != 0) {
+            return -1;
+        }
+        sc->has_path = 0;
+        sc->has_linkname = 0;
+        sc->has_size = 0;
+        sc->no_entries++;
+        return 1;
+    }
+}
+
+// Fingerprints a fully scanned archive
+static int scan_fingerprint(const struct scan *sc, tar_fingerprint_t *fingerprint) {
+    struct stat st;
+    if (fstat(sc->tar_fd, &st) != 0) {
+        return -1;
+    }
+    fingerprint->archive_size = st.st_size;
+    fingerprint->no_entries = sc->no_entries;
+    fingerprint->header_hash = sc->hash;
+    return 0;
+}
+
+// Scans the headers of an archive to fingerprint it
+static int archive_fingerprint(int tar_fd, tar_fingerprint_t *fingerprint) {
+    struct scan sc;
+    tar_entry_t entry;
+    int ret;
+
+    scan_init(&sc, tar_fd);
+    while ((ret = scan_next(&sc, &entry)) == 1) {
+    }
+    if (ret == 0) {
+        ret = scan_fingerprint(&sc, fingerprint);
+    }
+    scan_free(&sc);
+    return ret;
+}
+
+// Walks the entries in archive order, through the index of the archive if there is one
+struct entry_iter {
+    const tar_index_t *index;
+    size_t next;
+    struct scan sc;
+};
+
+static void iter_init(struct entry_iter *it, const tar_archive_t *archive) {
+    it->index = archive->index;
+    it->next = 0;
+    scan_init(&it->sc, archive->tar_fd);
+}
+
+static int iter_next(struct entry_iter *it, tar_entry_t *entry) {
+    if (it->index != NULL) {
+        if (it->next == it->index->no_entries) {
+            return 0;
         }
+        *entry = it->index->entries[it->next++];
+        return 1;
+    }
+    return scan_next(&it->sc, entry);
+}
+
+static void iter_free(struct entry_iter *it) {
+    scan_free(&it->sc);
+}
 
-        char name[TAR_NAME_SIZE + 1];
-        memcpy(name, buffer, TAR_NAME_SIZE);
-        name[TAR_NAME_SIZE] = '\0';
+// Finds the first entry at the given path, its strings stay valid until iter_free(it)
+static int find_entry(const tar_archive_t *archive, const char *path, struct entry_iter *it, tar_entry_t *entry) {
+    iter_init(it, archive);
+    // A miss reported by the filter is certain, the archive is not read
+    if (archive->bloom != NULL && !tar_bloom_may_contain(archive->bloom, path)) {
+        return 0;
+    }
 
-        if (strcmp(name, path) == 0) {
+    size_t path_len = strlen(path);
+    if (it->index != NULL) {
+        const tar_entry_t *found = tar_index_find(it->index, path, path_len);
+        if (found == NULL) {
+            return 0;
+        }
+        *entry = *found;
+        return 1;
+    }
+
+    while (iter_next(it, entry) == 1) {
+        if (entry->path_len == path_len && memcmp(entry->path, path, path_len) == 0) {
             return 1;
         }
     }
     return 0;
+}
+
+/**
+ * Checks whether an entry exists in the archive.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param path A path to an entry in the archive.
+ *
+ * @return zero if no entry at the given path exists in the archive,
+ *         any other value otherwise.
+ */
+int exists(int tar_fd, char *path){
+    tar_archive_t archive = { .tar_fd = tar_fd };
+    return tar_exists(&archive, path);
+}
 
+/**
+ * Same as exists(), using the index and the filter of the archive when they are set.
+ */
+int tar_exists(const tar_archive_t *archive, const char *path) {
+    struct entry_iter it;
+    tar_entry_t entry;
 
+    int found = find_entry(archive, path, &it, &entry);
+    iter_free(&it);
+    return found;
 }
 
 
@@ -143,43 +517,15 @@ int check_archive(int tar_fd) {
 }
 
 // Just a function to regroup "is_dir", "is_file", "is_symlink" because they are very similar
-int is_smth(int tar_fd, char *path, char type){
-
-    uint8_t buffer[TAR_BLOCK_SIZE];
-
-    // Go back to the beginning of the tar
-    if (lseek(tar_fd, 0, SEEK_SET) == -1) {
-        return 0;
-    }
-
-    while (read(tar_fd, buffer, TAR_BLOCK_SIZE) == TAR_BLOCK_SIZE) {
-
-        int is_null_block = 1;
-        for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
-            if (buffer[i] != 0) {
-                is_null_block = 0;
-                break;
-            }
-        }
-        if (is_null_block) {
-            break;
-        }
-
-        char name[TAR_NAME_SIZE + 1];
-        memcpy(name, buffer, TAR_NAME_SIZE);
-        name[TAR_NAME_SIZE] = '\0';
-
-        if (strcmp(name, path) == 0) {
-            // Verify if it's the right type
-            char typeflag = buffer[TAR_TYPEFLAG_OFFSET];
-            if (typeflag == type) {
-                return 1;
-            }
-            return 0;
-        }
-    }
-    return 0;
-} 
+int is_smth(const tar_archive_t *archive, const char *path, char type){
+    struct entry_iter it;
+    tar_entry_t entry;
+
+    // Verify if it's the right type
+    int found = find_entry(archive, path, &it, &entry) && entry.typeflag == type;
+    iter_free(&it);
+    return found;
+}
 
 
 /**
@@ -192,7 +538,15 @@ int is_smth(int tar_fd, char *path, char type){
  *         any other value otherwise.
  */
 int is_dir(int tar_fd, char *path) {
-    return is_smth(tar_fd, path, (char) DIRTYPE);
+    tar_archive_t archive = { .tar_fd = tar_fd };
+    return is_smth(&archive, path, (char) DIRTYPE);
+}
+
+/**
+ * Same as is_dir(), using the index and the filter of the archive when they are set.
+ */
+int tar_is_dir(const tar_archive_t *archive, const char *path) {
+    return is_smth(archive, path, (char) DIRTYPE);
 }
 
 /**
@@ -205,7 +559,15 @@ int is_dir(int tar_fd, char *path) {
  *         any other value otherwise.
  */
 int is_file(int tar_fd, char *path) {
-    return is_smth(tar_fd, path, (char) REGTYPE);
+    tar_archive_t archive = { .tar_fd = tar_fd };
+    return is_smth(&archive, path, (char) REGTYPE);
+}
+
+/**
+ * Same as is_file(), using the index and the filter of the archive when they are set.
+ */
+int tar_is_file(const tar_archive_t *archive, const char *path) {
+    return is_smth(archive, path, (char) REGTYPE);
 }
 
 /**
@@ -217,10 +579,18 @@ int is_file(int tar_fd, char *path) {
  *         any other value otherwise.
  */
 int is_symlink(int tar_fd, char *path) {
-    return is_smth(tar_fd, path, (char) SYMTYPE);
+    tar_archive_t archive = { .tar_fd = tar_fd };
+    return is_smth(&archive, path, (char) SYMTYPE);
+}
+
+/**
+ * Same as is_symlink(), using the index and the filter of the archive when they are set.
+ */
+int tar_is_symlink(const tar_archive_t *archive, const char *path) {
+    return is_smth(archive, path, (char) SYMTYPE);
 }
 
-int check_for_list(char *name, size_t pathlen){
+int check_for_list(const char *name, size_t pathlen){
     int check = 0;
     for(int i=pathlen+1; name[i] != '\0'; i++){
         if(name[i]=='/'){
@@ -257,7 +627,14 @@ int check_for_list(char *name, size_t pathlen){
  *         any other value otherwise.
  */
 int list(int tar_fd, char *path, char **entries, size_t *no_entries) {
-    uint8_t buffer[TAR_BLOCK_SIZE];
+    tar_archive_t archive = { .tar_fd = tar_fd };
+    return tar_list(&archive, path, entries, no_entries);
+}
+
+/**
+ * Same as list(), using the index and the filter of the archive when they are set.
+ */
+int tar_list(const tar_archive_t *archive, const char *path, char **entries, size_t *no_entries) {
     size_t entries_found = 0;
     size_t path_len = strlen(path);
 
@@ -266,7 +643,7 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries) {
  
     char *adjusted_path = NULL;
     // add a '/' in the end of the path if it's not yet done 
-    if (path[path_len - 1] != '/' && is_symlink(tar_fd, path) != 1) {
+    if (path[path_len - 1] != '/' && tar_is_symlink(archive, path) != 1) {
   
         adjusted_path = malloc(path_len + 2);
         if (adjusted_path == NULL) {
@@ -287,59 +664,42 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries) {
     }
 
 
-    // Go back to the beginning of the tar
-    if (lseek(tar_fd, 0, SEEK_SET) == -1) {
-        return 0;
-    }
+    struct entry_iter it;
+    tar_entry_t entry;
+    iter_init(&it, archive);
 
-    while (read(tar_fd, buffer, TAR_BLOCK_SIZE) == TAR_BLOCK_SIZE) {
-        // Check for null block
-        int is_null_block = 1;
-        for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
-            if (buffer[i] != 0) {
-                is_null_block = 0;
-                break;
-            }
-        }
-        if (is_null_block) {
-            break;
-        }
+    while (iter_next(&it, &entry) == 1) {
+        // Check if the entry matches the given path
+        if (strncmp(entry.path, adjusted_path, path_len) == 0) {
 
-        char name[TAR_NAME_SIZE + 1];
-        memcpy(name, buffer, TAR_NAME_SIZE);
-        name[TAR_NAME_SIZE] = '\0';
+                if(entry.path_len == path_len){
 
-        // Check if the entry matches the given path
-        if (strncmp(name, adjusted_path, path_len) == 0) {
-          
-                if(strlen(name) == path_len){
-                    
-                    if(buffer[TAR_TYPEFLAG_OFFSET] == SYMTYPE){
-    
-                        char linkname[TAR_NAME_SIZE + 1];
-                        memcpy(linkname, buffer + TAR_LINKNAME_OFFSET, TAR_NAME_SIZE);
-                        linkname[TAR_NAME_SIZE] = '\0';
+                    if(entry.typeflag == SYMTYPE){
+                        // The link name stays valid until iter_free
+                        int ret = tar_list(archive, entry.linkname, entries, no_entries);
+                        iter_free(&it);
                         free(adjusted_path);
-                        return list(tar_fd, linkname, entries, no_entries);
+                        return ret;
                     } else {
                         continue;
                     }
                 } else {
-                    if((check_for_list(name, path_len) == 1 && buffer[TAR_TYPEFLAG_OFFSET] == DIRTYPE) || check_for_list(name, path_len) == 0){
+                    if((check_for_list(entry.path, path_len) == 1 && entry.typeflag == DIRTYPE) || check_for_list(entry.path, path_len) == 0){
                         if (entries_found < *no_entries) {
                         // Allocate memory for the entry
-                            entries[entries_found] = malloc(TAR_NAME_SIZE + 1);
+                            entries[entries_found] = malloc(entry.path_len + 1);
                             if (entries[entries_found] == NULL) {
                                 fprintf(stderr, "Memory allocation failed\n");
                                 for (size_t i = 0; i < entries_found; i++) {
                                     free(entries[i]);
                                 }
+                                iter_free(&it);
+                                free(adjusted_path);
                                 return 0;
                             }
 
 
-                            strncpy(entries[entries_found], name, TAR_NAME_SIZE);
-                            entries[entries_found][TAR_NAME_SIZE] = '\0';
+                            memcpy(entries[entries_found], entry.path, entry.path_len + 1);
 
                         }
                         entries_found++;
@@ -350,6 +710,7 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries) {
         }
     }
 
+    iter_free(&it);
     *no_entries = entries_found;
     free(adjusted_path);
     return entries_found > 0 ? 1 : 0;
@@ -376,124 +737,798 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries) {
  */
 
 
-static size_t octal_s(const char *octal){
-    size_t size = 0;
-    sscanf(octal, "%zo", &size);
-    return size;
-
+ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len) {
+    tar_archive_t archive = { .tar_fd = tar_fd };
+    return tar_read_file(&archive, path, offset, dest, len);
 }
 
-
-ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len) {
-    if (tar_fd < 0 || !path || !dest || !len || *len == 0) {
+/**
+ * Same as read_file(), using the index and the filter of the archive when they are set.
+ */
+ssize_t tar_read_file(const tar_archive_t *archive, const char *path, uint64_t offset, uint8_t *dest, size_t *len) {
+    if (archive->tar_fd < 0 || !path || !dest || !len || *len == 0) {
         return -1;
     }
 
-    char current_p[TAR_BLOCK_SIZE + 1];
-    strncpy(current_p, path, TAR_NAME_SIZE);
-    current_p[TAR_NAME_SIZE] = '\0';
+    struct entry_iter it;
+    tar_entry_t entry;
+    ssize_t ret = -1;
 
-    if (lseek(tar_fd, 0, SEEK_SET) == -1) {
-        return -1;
+    if (find_entry(archive, path, &it, &entry)) {
+        if (entry.typeflag == SYMTYPE) {
+            // Recursive call to resolve the symlink, the link name stays valid until iter_free
+            ret = tar_read_file(archive, entry.linkname, offset, dest, len);
+        } else if (entry.typeflag == REGTYPE) {
+            ret = tar_read_entry(archive->tar_fd, &entry, offset, dest, len);
+        }
     }
+    iter_free(&it);
+    return ret;
+}
 
-    uint8_t header[TAR_BLOCK_SIZE];
+// A regular file selected by tar_grep, with the position of its data in the archive
+struct grep_member {
+    char *name;
+    uint64_t data_offset;
+    uint64_t size;
+};
+
+// State shared by the tar_grep workers, next_member and the callback are protected by lock
+struct grep_ctx {
+    int tar_fd;
+    const char **patterns;
+    size_t *pattern_lens;
+    size_t no_patterns;
+    size_t max_len;
+    struct grep_member *members;
+    size_t no_members;
+    size_t next_member;
+    tar_grep_cb cb;
+    void *arg;
+    pthread_mutex_t lock;
+    ssize_t matches;
+    int stop;
+    int error;
+};
+
+static int grep_filter_match(const char *filter, const char *name) {
+    if (filter == NULL) {
+        return 1;
+    }
+    if (strpbrk(filter, "*?[") != NULL) {
+        return fnmatch(filter, name, 0) == 0;
+    }
+    return strncmp(name, filter, strlen(filter)) == 0;
+}
 
-    while (read(tar_fd, header, TAR_BLOCK_SIZE) == TAR_BLOCK_SIZE) {
-        int is_null_block = 1;
-        for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
-            if (header[i] != 0) {
-                is_null_block = 0;
+// Collects the regular files accepted by the filter, from the index if any, else in one header scan
+static int grep_collect(struct grep_ctx *ctx, const tar_archive_t *archive, const char *filter) {
+    struct entry_iter it;
+    tar_entry_t entry;
+    size_t capacity = 0;
+    int ret;
+
+    iter_init(&it, archive);
+    while ((ret = iter_next(&it, &entry)) == 1) {
+        if ((entry.typeflag == REGTYPE || entry.typeflag == AREGTYPE) && entry.size > 0
+            && grep_filter_match(filter, entry.path)) {
+            if (ctx->no_members == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                struct grep_member *members = realloc(ctx->members, capacity * sizeof(*members));
+                if (members == NULL) {
+                    ret = -1;
+                    break;
+                }
+                ctx->members = members;
+            }
+            struct grep_member *member = &ctx->members[ctx->no_members];
+            member->name = strdup(entry.path);
+            if (member->name == NULL) {
+                ret = -1;
                 break;
             }
+            member->data_offset = entry.data_offset;
+            member->size = entry.size;
+            ctx->no_members++;
         }
-        if (is_null_block) {
-            break;
+    }
+    iter_free(&it);
+    return ret;
+}
+
+static void grep_free_members(struct grep_ctx *ctx) {
+    for (size_t i = 0; i < ctx->no_members; i++) {
+        free(ctx->members[i].name);
+    }
+    free(ctx->members);
+}
+
+// Reports a match, returns non-zero if the search must stop
+static int grep_report(struct grep_ctx *ctx, const struct grep_member *member, uint64_t offset, size_t pattern) {
+    pthread_mutex_lock(&ctx->lock);
+    int stop = ctx->stop;
+    if (!stop) {
+        ctx->matches++;
+        if (ctx->cb(member->name, offset, pattern, ctx->arg) != 0) {
+            ctx->stop = 1;
+            stop = 1;
         }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return stop;
+}
 
-        char file_name[TAR_NAME_SIZE + 1];
-        memcpy(file_name, header, TAR_NAME_SIZE);
-        file_name[TAR_NAME_SIZE] = '\0';
+/*
+ * Searches a window for one pattern with memmem, which glibc vectorises. Each pattern gets its
+ * own pass over the window: the window is already in cache, and a vectorised pass per pattern
+ * is faster than a byte-by-byte pass over all of them. Returns non-zero if the search must stop.
+ */
+static int grep_window(struct grep_ctx *ctx, const struct grep_member *member, const uint8_t *buffer,
+                       size_t window, size_t carry, uint64_t window_start, size_t pattern) {
+    size_t plen = ctx->pattern_lens[pattern];
+    const uint8_t *cur = buffer;
+    const uint8_t *end = buffer + window;
+    while ((size_t)(end - cur) >= plen) {
+        const uint8_t *hit = memmem(cur, end - cur, ctx->patterns[pattern], plen);
+        if (hit == NULL) {
+            break;
+        }
+        size_t at = hit - buffer;
+        if (at + plen > carry && grep_report(ctx, member, window_start + at, pattern)) {
+            return 1;
+        }
+        cur = hit + 1;
+    }
+    return 0;
+}
 
-        if (strcmp(file_name, path) == 0) {
-            char typeflag = header[TAR_TYPEFLAG_OFFSET];
-            
-            // Handle symlink case
-            if (typeflag == '2') { // '2' indicates a symlink
-                char linked_path[TAR_NAME_SIZE + 1];
-                memcpy(linked_path, header + TAR_LINKNAME_OFFSET, TAR_NAME_SIZE);
-                linked_path[TAR_NAME_SIZE] = '\0';
+/*
+ * Streams a member through the matcher chunk by chunk.
+ * The last max_len - 1 bytes of a chunk are carried over to the next one so that
+ * matches spanning two chunks are found, a match lying entirely in the carried bytes
+ * was already reported with the previous chunk and is skipped.
+ */
+static int grep_member(struct grep_ctx *ctx, const struct grep_member *member, uint8_t *buffer) {
+    size_t carry = 0;
+    uint64_t done = 0;
+
+    while (done < member->size) {
+        size_t to_read = member->size - done < TAR_GREP_CHUNK ? member->size - done : TAR_GREP_CHUNK;
+        ssize_t got = pread(ctx->tar_fd, buffer + carry, to_read, member->data_offset + done);
+        if (got <= 0) {
+            return -1;
+        }
+        size_t window = carry + got;
+        uint64_t window_start = done - carry;
 
-                // Recursive call to resolve the symlink
-                return read_file(tar_fd, linked_path, offset, dest, len);
+        for (size_t p = 0; p < ctx->no_patterns; p++) {
+            if (grep_window(ctx, member, buffer, window, carry, window_start, p)) {
+                return 0;
             }
+        }
 
-            if (typeflag != REGTYPE) {
-                return -1;
-            }
+        done += got;
+        carry = window < ctx->max_len - 1 ? window : ctx->max_len - 1;
+        memmove(buffer, buffer + window - carry, carry);
+    }
+    return 0;
+}
 
-            char size_str[12];
-            memcpy(size_str, header + 124, 11);
-            size_str[11] = '\0';
-            size_t file_size = octal_s(size_str);
+static void *grep_worker(void *data) {
+    struct grep_ctx *ctx = data;
+    uint8_t *buffer = malloc(TAR_GREP_CHUNK + ctx->max_len);
+    if (buffer == NULL) {
+        pthread_mutex_lock(&ctx->lock);
+        ctx->error = 1;
+        pthread_mutex_unlock(&ctx->lock);
+        return NULL;
+    }
 
-            if (offset >= file_size) {
-                return -2;
-            }
+    for (;;) {
+        pthread_mutex_lock(&ctx->lock);
+        int done = ctx->stop || ctx->error || ctx->next_member >= ctx->no_members;
+        size_t i = 0;
+        if (!done) {
+            i = ctx->next_member++;
+        }
+        pthread_mutex_unlock(&ctx->lock);
+        if (done) {
+            break;
+        }
 
-            size_t bytes_to_read = *len;
-            if (offset + bytes_to_read > file_size) {
-                bytes_to_read = file_size - offset;
-            }
+        if (grep_member(ctx, &ctx->members[i], buffer) != 0) {
+            pthread_mutex_lock(&ctx->lock);
+            ctx->error = 1;
+            pthread_mutex_unlock(&ctx->lock);
+            break;
+        }
+    }
 
-            size_t blocks_to_skip = offset / TAR_BLOCK_SIZE;
-            size_t block_offset = offset % TAR_BLOCK_SIZE;
+    free(buffer);
+    return NULL;
+}
 
-            for (size_t i = 0; i < blocks_to_skip; i++) {
-                if (read(tar_fd, header, TAR_BLOCK_SIZE) != TAR_BLOCK_SIZE) {
-                    return -1;
-                }
-            }
+/**
+ * Searches the data of every regular file in the archive for one or more patterns.
+ *
+ * @param archive The archive to search, its index is used instead of scanning the headers when set.
+ * @param patterns An array of non-empty byte strings to search for.
+ * @param no_patterns The number of entries in `patterns`.
+ * @param filter NULL to search every file, a glob if it contains any of '*', '?' or '[', a path prefix otherwise.
+ * @param cb The callback to report matches to.
+ * @param arg An opaque value given back to `cb`.
+ * @param no_threads The number of worker threads, zero or a negative value to use one per online CPU.
+ *
+ * @return the number of matches reported,
+ *         -1 if the arguments are invalid or an error occurred while reading the archive.
+ */
+ssize_t tar_grep(const tar_archive_t *archive, const char **patterns, size_t no_patterns, const char *filter,
+                 tar_grep_cb cb, void *arg, int no_threads) {
+    if (!archive || archive->tar_fd < 0 || !patterns || no_patterns == 0 || !cb) {
+        return -1;
+    }
 
-            uint8_t first_block[TAR_BLOCK_SIZE];
-            if (read(tar_fd, first_block, TAR_BLOCK_SIZE) != TAR_BLOCK_SIZE) {
-                return -1;
-            }
+    struct grep_ctx ctx = {
+        .tar_fd = archive->tar_fd,
+        .patterns = patterns,
+        .no_patterns = no_patterns,
+        .cb = cb,
+        .arg = arg,
+    };
 
-            size_t first_copy = (TAR_BLOCK_SIZE - block_offset < bytes_to_read) ?
-                TAR_BLOCK_SIZE - block_offset : bytes_to_read;
-            memcpy(dest, first_block + block_offset, first_copy);
+    ctx.pattern_lens = malloc(no_patterns * sizeof(size_t));
+    if (ctx.pattern_lens == NULL) {
+        return -1;
+    }
+    for (size_t p = 0; p < no_patterns; p++) {
+        ctx.pattern_lens[p] = patterns[p] ? strlen(patterns[p]) : 0;
+        if (ctx.pattern_lens[p] == 0) {
+            free(ctx.pattern_lens);
+            return -1;
+        }
+        if (ctx.pattern_lens[p] > ctx.max_len) {
+            ctx.max_len = ctx.pattern_lens[p];
+        }
+    }
 
-            size_t total_read = first_copy;
-            while (total_read < bytes_to_read) {
-                size_t remaining = bytes_to_read - total_read;
-                size_t to_read = remaining > TAR_BLOCK_SIZE ? TAR_BLOCK_SIZE : remaining;
+    if (grep_collect(&ctx, archive, filter) != 0) {
+        grep_free_members(&ctx);
+        free(ctx.pattern_lens);
+        return -1;
+    }
 
-                if (read(tar_fd, first_block, TAR_BLOCK_SIZE) != TAR_BLOCK_SIZE) {
-                    return -1;
-                }
+    if (no_threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        no_threads = cpus > 0 ? (int) cpus : 1;
+    }
+    if ((size_t) no_threads > ctx.no_members) {
+        no_threads = ctx.no_members > 0 ? (int) ctx.no_members : 1;
+    }
 
-                memcpy(dest + total_read, first_block, to_read);
-                total_read += to_read;
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_t *threads = malloc(no_threads * sizeof(pthread_t));
+    int started = 0;
+    if (threads != NULL) {
+        while (started < no_threads && pthread_create(&threads[started], NULL, grep_worker, &ctx) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        // Could not spawn any thread, do the work on the calling one
+        grep_worker(&ctx);
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_mutex_destroy(&ctx.lock);
+
+    free(threads);
+    grep_free_members(&ctx);
+    free(ctx.pattern_lens);
+    return ctx.error ? -1 : ctx.matches;
+}
+
+
+// FNV-1a followed by the splitmix64 finalizer to spread the bits
+static uint64_t bloom_hash(const char *path) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const unsigned char *c = (const unsigned char *) path; *c != '\0'; c++) {
+        h ^= *c;
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+// The k bit positions are derived from one hash with double hashing (h1 + i * h2)
+static void bloom_add(tar_bloom_t *bloom, uint64_t h) {
+    uint64_t h1 = h;
+    uint64_t h2 = (h >> 32 | h << 32) | 1;
+    for (uint32_t i = 0; i < bloom->no_hashes; i++) {
+        uint64_t bit = (h1 + i * h2) % bloom->no_bits;
+        bloom->bits[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+static int bloom_test(const tar_bloom_t *bloom, uint64_t h) {
+    uint64_t h1 = h;
+    uint64_t h2 = (h >> 32 | h << 32) | 1;
+    for (uint32_t i = 0; i < bloom->no_hashes; i++) {
+        uint64_t bit = (h1 + i * h2) % bloom->no_bits;
+        if (!(bloom->bits[bit / 64] & (1ULL << (bit % 64)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Sizes the filter for no_keys paths and allocates its cleared bit array
+static int bloom_init(tar_bloom_t *bloom, size_t no_keys, double fp_rate, size_t max_bytes) {
+    if (no_keys == 0) {
+        no_keys = 1;
+    }
+
+    // Optimal sizing: k = log2(1/p) hashes and m = n * k / ln(2) bits,
+    // with k clamped first so that the bits are sized for the hashes actually used
+    double k = ceil(-log2(fp_rate));
+    if (k > TAR_BLOOM_MAX_HASHES) {
+        k = TAR_BLOOM_MAX_HASHES;
+    }
+    double m = ceil(no_keys * k / M_LN2);
+    bloom->no_bits = ((uint64_t) m + 63) / 64 * 64;
+    if (max_bytes > 0 && bloom->no_bits > (uint64_t) max_bytes * 8) {
+        // Round down so that the bound holds, one word is the minimum
+        bloom->no_bits = (uint64_t) max_bytes * 8 / 64 * 64;
+        if (bloom->no_bits == 0) {
+            bloom->no_bits = 64;
+        }
+        double capped_k = round((double) bloom->no_bits / no_keys * M_LN2);
+        if (capped_k < k) {
+            k = capped_k;
+        }
+    }
+    bloom->no_hashes = k < 1 ? 1 : (uint32_t) k;
+    bloom->bits = calloc(bloom->no_bits / 64, sizeof(uint64_t));
+    return bloom->bits == NULL ? -1 : 0;
+}
+
+/**
+ * Builds a Bloom filter over every entry path of the archive in a single pass over the headers.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param fp_rate The wanted false-positive rate, in ]0, 1[.
+ * @param max_bytes An upper bound on the memory used by the bit array, zero for no bound.
+ * @param bloom The filter to initialize, to be released with tar_bloom_free().
+ *
+ * @return zero on success,
+ *         -1 if the arguments are invalid or an error occurred.
+ */
+int tar_bloom_build(int tar_fd, double fp_rate, size_t max_bytes, tar_bloom_t *bloom) {
+    if (tar_fd < 0 || !bloom || !(fp_rate > 0 && fp_rate < 1)) {
+        return -1;
+    }
+
+    // The paths are hashed during the scan, the filter can only be sized once they are all counted
+    uint64_t *hashes = NULL;
+    size_t no_hashes = 0;
+    size_t capacity = 0;
+    struct scan sc;
+    tar_entry_t entry;
+    int ret;
+
+    scan_init(&sc, tar_fd);
+    while ((ret = scan_next(&sc, &entry)) == 1) {
+        if (no_hashes == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            uint64_t *grown = realloc(hashes, capacity * sizeof(uint64_t));
+            if (grown == NULL) {
+                ret = -1;
+                break;
             }
+            hashes = grown;
+        }
+        hashes[no_hashes++] = bloom_hash(entry.path);
+    }
+    tar_fingerprint_t fingerprint;
+    if (ret == 0) {
+        ret = scan_fingerprint(&sc, &fingerprint);
+    }
+    scan_free(&sc);
+    if (ret != 0) {
+        free(hashes);
+        return -1;
+    }
+
+    if (bloom_init(bloom, no_hashes, fp_rate, max_bytes) != 0) {
+        free(hashes);
+        return -1;
+    }
+
+    bloom->fingerprint = fingerprint;
+    for (size_t i = 0; i < no_hashes; i++) {
+        bloom_add(bloom, hashes[i]);
+    }
+    free(hashes);
+    return 0;
+}
+
+/**
+ * Builds a Bloom filter over the entry paths of an index, without reading the archive.
+ *
+ * @param index An index built by tar_index_build().
+ * @param fp_rate The wanted false-positive rate, in ]0, 1[.
+ * @param max_bytes An upper bound on the memory used by the bit array, zero for no bound.
+ * @param bloom The filter to initialize, to be released with tar_bloom_free().
+ *
+ * @return zero on success,
+ *         -1 if the arguments are invalid or an error occurred.
+ */
+int tar_bloom_build_from_index(const tar_index_t *index, double fp_rate, size_t max_bytes, tar_bloom_t *bloom) {
+    if (!index || !bloom || !(fp_rate > 0 && fp_rate < 1)) {
+        return -1;
+    }
+    if (bloom_init(bloom, index->no_entries, fp_rate, max_bytes) != 0) {
+        return -1;
+    }
+    bloom->fingerprint = index->fingerprint;
+    for (size_t i = 0; i < index->no_entries; i++) {
+        bloom_add(bloom, bloom_hash(index->entries[i].path));
+    }
+    return 0;
+}
+
+/**
+ * Checks whether a path may be in the archive the filter was built from.
+ *
+ * @return zero if the path is certainly not in the archive,
+ *         any other value otherwise.
+ */
+int tar_bloom_may_contain(const tar_bloom_t *bloom, const char *path) {
+    // A released or zeroed filter knows nothing
+    if (bloom->bits == NULL || bloom->no_bits == 0) {
+        return 1;
+    }
+    return bloom_test(bloom, bloom_hash(path));
+}
 
-            *len = total_read;
-            return (offset + total_read == file_size) ? 0 : (file_size - (offset + total_read));
+// Writes the whole buffer, going on after short writes and interrupted calls
+static int write_all(int fd, const void *data, size_t size) {
+    const uint8_t *cur = data;
+    while (size > 0) {
+        ssize_t done = write(fd, cur, size);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return -1;
+        }
+        cur += done;
+        size -= done;
+    }
+    return 0;
+}
+
+// Fills the whole buffer, going on after short reads and interrupted calls, fails at end of file
+static int read_all(int fd, void *data, size_t size) {
+    uint8_t *cur = data;
+    while (size > 0) {
+        ssize_t done = read(fd, cur, size);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return -1;
         }
+        cur += done;
+        size -= done;
+    }
+    return 0;
+}
 
-        char size_str[12];
-        memcpy(size_str, header + 124, 11);
-        size_str[11] = '\0';
-        size_t file_size = octal_s(size_str);
-        size_t blocks = (file_size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE;
+static void store_le64(uint8_t *dest, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        dest[i] = (uint8_t) (value >> (8 * i));
+    }
+}
 
-        for (size_t i = 0; i < blocks; i++) {
-            uint8_t skip_block[TAR_BLOCK_SIZE];
-            if (read(tar_fd, skip_block, TAR_BLOCK_SIZE) != TAR_BLOCK_SIZE) {
-                return -1;
+static uint64_t load_le64(const uint8_t *src) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t) src[i] << (8 * i);
+    }
+    return value;
+}
+
+/*
+ * Saved filters start with a header of TAR_BLOOM_HEADER_SIZE bytes, all numbers little-endian:
+ *   0  magic            16  no_hashes     32  no_entries
+ *   8  no_bits          24  archive_size  40  header_hash
+ * the rest of the header is zero. The bit array follows as no_bits / 64 words.
+ */
+
+/**
+ * Writes the filter and the fingerprint of its archive to a file descriptor, in little-endian order.
+ *
+ * @return zero on success, -1 on a write error.
+ */
+int tar_bloom_save(const tar_bloom_t *bloom, int fd) {
+    uint8_t header[TAR_BLOOM_HEADER_SIZE] = {0};
+    memcpy(header, TAR_BLOOM_MAGIC, TAR_BLOOM_MAGIC_SIZE);
+    store_le64(header + 8, bloom->no_bits);
+    store_le64(header + 16, bloom->no_hashes);
+    store_le64(header + 24, bloom->fingerprint.archive_size);
+    store_le64(header + 32, bloom->fingerprint.no_entries);
+    store_le64(header + 40, bloom->fingerprint.header_hash);
+    if (write_all(fd, header, sizeof(header)) != 0) {
+        return -1;
+    }
+
+    uint8_t buffer[TAR_BLOCK_SIZE];
+    uint64_t no_words = bloom->no_bits / 64;
+    for (uint64_t w = 0; w < no_words;) {
+        size_t used = 0;
+        for (; w < no_words && used < sizeof(buffer); w++, used += 8) {
+            store_le64(buffer + used, bloom->bits[w]);
+        }
+        if (write_all(fd, buffer, used) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Reads a filter written by tar_bloom_save() from a file descriptor, checking it was built from the given archive.
+ *
+ * @return zero on success,
+ *         -1 on a read error or if the data is not a saved filter,
+ *         -2 if the filter was built from another archive or another version of it.
+ */
+int tar_bloom_load(int fd, const tar_archive_t *archive, tar_bloom_t *bloom) {
+    uint8_t header[TAR_BLOOM_HEADER_SIZE];
+    if (read_all(fd, header, sizeof(header)) != 0
+        || memcmp(header, TAR_BLOOM_MAGIC, TAR_BLOOM_MAGIC_SIZE) != 0) {
+        return -1;
+    }
+    uint64_t no_bits = load_le64(header + 8);
+    uint64_t no_hashes = load_le64(header + 16);
+    if (no_bits == 0 || no_bits % 64 != 0 || no_bits / 8 > SIZE_MAX
+        || no_hashes == 0 || no_hashes > TAR_BLOOM_MAX_HASHES) {
+        return -1;
+    }
+
+    tar_fingerprint_t saved = {
+        .archive_size = load_le64(header + 24),
+        .no_entries = load_le64(header + 32),
+        .header_hash = load_le64(header + 40),
+    };
+    tar_fingerprint_t current;
+    if (archive->index != NULL) {
+        current = archive->index->fingerprint;
+    } else if (archive_fingerprint(archive->tar_fd, &current) != 0) {
+        return -1;
+    }
+    if (saved.archive_size != current.archive_size || saved.no_entries != current.no_entries
+        || saved.header_hash != current.header_hash) {
+        return -2;
+    }
+
+    uint64_t *bits = malloc(no_bits / 8);
+    if (bits == NULL) {
+        return -1;
+    }
+    uint8_t buffer[TAR_BLOCK_SIZE];
+    uint64_t no_words = no_bits / 64;
+    for (uint64_t w = 0; w < no_words;) {
+        size_t used = no_words - w < sizeof(buffer) / 8 ? (no_words - w) * 8 : sizeof(buffer);
+        if (read_all(fd, buffer, used) != 0) {
+            free(bits);
+            return -1;
+        }
+        for (size_t at = 0; at < used; at += 8) {
+            bits[w++] = load_le64(buffer + at);
+        }
+    }
+
+    bloom->bits = bits;
+    bloom->no_bits = no_bits;
+    bloom->no_hashes = (uint32_t) no_hashes;
+    bloom->fingerprint = saved;
+    return 0;
+}
+
+/**
+ * Releases the memory held by a filter.
+ */
+void tar_bloom_free(tar_bloom_t *bloom) {
+    free(bloom->bits);
+    bloom->bits = NULL;
+    bloom->no_bits = 0;
+}
+
+/**
+ * Reads the data of an entry found by tar_index_find() or in tar_index_t.entries.
+ *
+ * @return -1 if an error occurred while reading the archive,
+ *         -2 if the offset is outside the entry total length,
+ *         zero if the entry was read in its entirety into the destination buffer,
+ *         a positive value representing the remaining bytes left to be read to reach the end of the entry,
+ *         clamped to SSIZE_MAX.
+ */
+ssize_t tar_read_entry(int tar_fd, const tar_entry_t *entry, uint64_t offset, uint8_t *dest, size_t *len) {
+    if (offset >= entry->size) {
+        return -2;
+    }
+
+    uint64_t remaining = entry->size - offset;
+    size_t bytes_to_read = *len < remaining ? *len : (size_t) remaining;
+    size_t total_read = 0;
+    while (total_read < bytes_to_read) {
+        ssize_t got = pread(tar_fd, dest + total_read, bytes_to_read - total_read,
+                            entry->data_offset + offset + total_read);
+        if (got <= 0) {
+            return -1;
+        }
+        total_read += got;
+    }
+
+    *len = total_read;
+    // Entries can be larger than ssize_t on 32-bit hosts
+    uint64_t left = remaining - total_read;
+    return left > SSIZE_MAX ? SSIZE_MAX : (ssize_t) left;
+}
+
+static int path_cmp(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+// Orders by path, then by position in the archive so that the first of duplicated paths wins
+static int index_entry_cmp(const void *a, const void *b) {
+    const tar_entry_t *ea = *(const tar_entry_t * const *) a;
+    const tar_entry_t *eb = *(const tar_entry_t * const *) b;
+    int cmp = path_cmp(ea->path, ea->path_len, eb->path, eb->path_len);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (ea > eb) - (ea < eb);
+}
+
+/**
+ * Scans the archive once and builds an in-memory index of all its entries.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param index The index to initialize, to be released with tar_index_free().
+ *
+ * @return zero on success,
+ *         -1 if an error occurred.
+ */
+int tar_index_build(int tar_fd, tar_index_t *index) {
+    memset(index, 0, sizeof(*index));
+
+    struct scan sc;
+    tar_entry_t entry;
+    size_t capacity = 0;
+    size_t arena_len = 0;
+    size_t arena_cap = 0;
+    // Positions of the strings in the arena, which moves while it grows
+    size_t *offsets = NULL;
+    int ret;
+
+    scan_init(&sc, tar_fd);
+    while ((ret = scan_next(&sc, &entry)) == 1) {
+        size_t linkname_len = strlen(entry.linkname);
+        size_t needed = entry.path_len + 1 + linkname_len + 1;
+
+        if (index->no_entries == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            tar_entry_t *entries = realloc(index->entries, capacity * sizeof(tar_entry_t));
+            size_t *grown = realloc(offsets, capacity * 2 * sizeof(size_t));
+            if (entries != NULL) {
+                index->entries = entries;
+            }
+            if (grown != NULL) {
+                offsets = grown;
             }
+            if (entries == NULL || grown == NULL) {
+                ret = -1;
+                break;
+            }
+        }
+        if (arena_len + needed > arena_cap) {
+            size_t new_cap = arena_cap ? arena_cap * 2 : 4096;
+            while (new_cap < arena_len + needed) {
+                new_cap *= 2;
+            }
+            char *arena = realloc(index->arena, new_cap);
+            if (arena == NULL) {
+                ret = -1;
+                break;
+            }
+            index->arena = arena;
+            arena_cap = new_cap;
         }
+
+        size_t i = index->no_entries++;
+        offsets[2 * i] = arena_len;
+        memcpy(index->arena + arena_len, entry.path, entry.path_len + 1);
+        arena_len += entry.path_len + 1;
+        offsets[2 * i + 1] = arena_len;
+        memcpy(index->arena + arena_len, entry.linkname, linkname_len + 1);
+        arena_len += linkname_len + 1;
+        index->entries[i] = entry;
     }
+    if (ret == 0) {
+        ret = scan_fingerprint(&sc, &index->fingerprint);
+    }
+    scan_free(&sc);
 
-    return -1;
+    if (ret == 0) {
+        index->by_path = malloc((index->no_entries ? index->no_entries : 1) * sizeof(tar_entry_t *));
+        if (index->by_path == NULL) {
+            ret = -1;
+        }
+    }
+    if (ret != 0) {
+        free(offsets);
+        tar_index_free(index);
+        return -1;
+    }
+
+    for (size_t i = 0; i < index->no_entries; i++) {
+        index->entries[i].path = index->arena + offsets[2 * i];
+        index->entries[i].linkname = index->arena + offsets[2 * i + 1];
+        index->by_path[i] = &index->entries[i];
+    }
+    free(offsets);
+    qsort(index->by_path, index->no_entries, sizeof(tar_entry_t *), index_entry_cmp);
+    return 0;
+}
+
+/**
+ * Releases the memory held by an index.
+ */
+void tar_index_free(tar_index_t *index) {
+    free(index->entries);
+    free(index->by_path);
+    free(index->arena);
+    memset(index, 0, sizeof(*index));
+}
+
+/**
+ * Looks up an entry by path in an index.
+ *
+ * @param index An index built by tar_index_build().
+ * @param path The path of the entry, it does not need to be null terminated.
+ * @param path_len The length of `path`.
+ *
+ * @return the first entry of the archive at the given path,
+ *         NULL if there is none.
+ */
+const tar_entry_t *tar_index_find(const tar_index_t *index, const char *path, size_t path_len) {
+    size_t low = 0;
+    size_t high = index->no_entries;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        const tar_entry_t *entry = index->by_path[mid];
+        if (path_cmp(entry->path, entry->path_len, path, path_len) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < index->no_entries) {
+        const tar_entry_t *entry = index->by_path[low];
+        if (path_cmp(entry->path, entry->path_len, path, path_len) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
 }
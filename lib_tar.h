@@ -6,6 +6,10 @@
 #include <stdint.h>
 #include <unistd.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct posix_header
 {                              /* byte offset */
     char name[100];               /*   0 */
@@ -38,6 +42,10 @@ typedef struct posix_header
 #define LNKTYPE  '1'            /* link */
 #define SYMTYPE  '2'            /* reserved */
 #define DIRTYPE  '5'            /* directory */
+#define XHDTYPE  'x'            /* PAX extended header for the next entry */
+#define XGLTYPE  'g'            /* PAX global extended header */
+#define GNUTYPE_LONGNAME 'L'    /* GNU long name of the next entry */
+#define GNUTYPE_LONGLINK 'K'    /* GNU long link name of the next entry */
 
 /* Converts an ASCII-encoded octal-based number into a regular integer */
 #define TAR_INT(char_ptr) strtol(char_ptr, NULL, 8)
@@ -148,4 +156,246 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries);
  */
 ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len);
 
+/**
+ * An entry of the archive, as decoded from its header and the extended headers preceding it.
+ */
+typedef struct tar_entry {
+    const char *path;       /* full path: PAX path, GNU long name or ustar prefix and name */
+    size_t path_len;
+    const char *linkname;   /* PAX linkpath, GNU long link name or linkname */
+    char typeflag;
+    uint64_t size;          /* PAX size or size field, octal or base-256 */
+    uint64_t data_offset;   /* offset of the first data block in the archive */
+} tar_entry_t;
+
+/**
+ * Identifies the content of an archive, to tell whether what was built from it still matches it.
+ */
+typedef struct tar_fingerprint {
+    uint64_t archive_size;  /* size of the archive file */
+    uint64_t no_entries;
+    uint64_t header_hash;   /* FNV-1a over the header blocks and the extended header data */
+} tar_fingerprint_t;
+
+/**
+ * An in-memory index of the entries of an archive, built with a single scan of the headers.
+ */
+typedef struct tar_index {
+    tar_entry_t *entries;   /* in archive order */
+    size_t no_entries;
+    tar_entry_t **by_path;  /* the same entries sorted by path */
+    char *arena;            /* storage for the paths and link names */
+    tar_fingerprint_t fingerprint;
+} tar_index_t;
+
+/**
+ * Scans the archive once and builds an in-memory index of all its entries.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param index The index to initialize, to be released with tar_index_free().
+ *
+ * @return zero on success,
+ *         -1 if an error occurred.
+ */
+int tar_index_build(int tar_fd, tar_index_t *index);
+
+/**
+ * Releases the memory held by an index.
+ */
+void tar_index_free(tar_index_t *index);
+
+/**
+ * Looks up an entry by path in an index.
+ *
+ * @param index An index built by tar_index_build().
+ * @param path The path of the entry, it does not need to be null terminated.
+ * @param path_len The length of `path`.
+ *
+ * @return the first entry of the archive at the given path,
+ *         NULL if there is none.
+ */
+const tar_entry_t *tar_index_find(const tar_index_t *index, const char *path, size_t path_len);
+
+/**
+ * Reads the data of an entry with positioned reads, the file offset of tar_fd is left untouched.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param entry An entry of the archive, from an index.
+ * @param offset An offset in the entry from which to start reading from.
+ * @param dest A destination buffer to read the entry into.
+ * @param len An in-out argument.
+ *            The caller set it to the size of dest.
+ *            The callee set it to the number of bytes written to dest.
+ *
+ * @return -1 if an error occurred while reading the archive,
+ *         -2 if the offset is outside the entry total length,
+ *         zero if the entry was read in its entirety into the destination buffer,
+ *         a positive value representing the remaining bytes left to be read to reach the end of the entry.
+ *         It is clamped to SSIZE_MAX when the remaining bytes do not fit in ssize_t, as may happen on
+ *         32-bit hosts: read on until zero is returned rather than counting down the first value.
+ */
+ssize_t tar_read_entry(int tar_fd, const tar_entry_t *entry, uint64_t offset, uint8_t *dest, size_t *len);
+
+/**
+ * A Bloom filter over the entry paths of an archive.
+ * It answers "certainly absent" or "maybe present" for a path without reading the archive.
+ */
+typedef struct tar_bloom {
+    uint64_t *bits;
+    uint64_t no_bits;     /* a multiple of 64 */
+    uint32_t no_hashes;
+    tar_fingerprint_t fingerprint;  /* of the archive the filter was built from */
+} tar_bloom_t;
+
+/**
+ * Builds a Bloom filter over every entry path of the archive in a single pass over the headers.
+ *
+ * @param tar_fd A file descriptor pointing to a valid tar archive file.
+ * @param fp_rate The wanted false-positive rate, in ]0, 1[.
+ * @param max_bytes An upper bound on the memory used by the bit array, zero for no bound.
+ *                  If the bound is hit the filter is shrunk and the false-positive rate goes up.
+ * @param bloom The filter to initialize, to be released with tar_bloom_free().
+ *
+ * @return zero on success,
+ *         -1 if the arguments are invalid or an error occurred.
+ */
+int tar_bloom_build(int tar_fd, double fp_rate, size_t max_bytes, tar_bloom_t *bloom);
+
+/**
+ * Builds a Bloom filter over the entry paths of an index, without reading the archive.
+ * Building the index then the filter, and releasing the index if it is too large to keep,
+ * costs a single pass over the archive.
+ *
+ * @param index An index built by tar_index_build().
+ * @param fp_rate The wanted false-positive rate, in ]0, 1[.
+ * @param max_bytes An upper bound on the memory used by the bit array, zero for no bound.
+ * @param bloom The filter to initialize, to be released with tar_bloom_free().
+ *
+ * @return zero on success,
+ *         -1 if the arguments are invalid or an error occurred.
+ */
+int tar_bloom_build_from_index(const tar_index_t *index, double fp_rate, size_t max_bytes, tar_bloom_t *bloom);
+
+/**
+ * Checks whether a path may be in the archive the filter was built from.
+ *
+ * @return zero if the path is certainly not in the archive,
+ *         any other value otherwise.
+ */
+int tar_bloom_may_contain(const tar_bloom_t *bloom, const char *path);
+
+/**
+ * Releases the memory held by a filter.
+ */
+void tar_bloom_free(tar_bloom_t *bloom);
+
+/**
+ * An archive together with the optional structures speeding up its lookups.
+ * Nothing is shared between archives, so each caller can hold its own without any locking.
+ * The index and the filter must match the content of the archive read through tar_fd.
+ */
+typedef struct tar_archive {
+    int tar_fd;
+    const tar_index_t *index;   /* NULL to scan the headers on each lookup */
+    const tar_bloom_t *bloom;   /* NULL to not filter out misses before a lookup */
+} tar_archive_t;
+
+/**
+ * Writes the filter and the fingerprint of its archive to a file descriptor.
+ * The format is little-endian whatever the host, so a saved filter can be moved between machines.
+ *
+ * @return zero on success, -1 on a write error.
+ */
+int tar_bloom_save(const tar_bloom_t *bloom, int fd);
+
+/**
+ * Reads a filter written by tar_bloom_save() from a file descriptor.
+ * The filter is only accepted if its fingerprint matches the archive, taken from the index of the
+ * archive when it is set, otherwise computed with a scan of the headers.
+ *
+ * @param fd The file descriptor to read the filter from.
+ * @param archive The archive the filter is meant for.
+ * @param bloom The filter to initialize, to be released with tar_bloom_free().
+ *
+ * @return zero on success,
+ *         -1 on a read error or if the data is not a saved filter,
+ *         -2 if the filter was built from another archive or another version of it.
+ */
+int tar_bloom_load(int fd, const tar_archive_t *archive, tar_bloom_t *bloom);
+
+/**
+ * Same as exists(), using the index and the filter of the archive when they are set.
+ * A miss reported by the filter is answered without reading the archive.
+ */
+int tar_exists(const tar_archive_t *archive, const char *path);
+
+/**
+ * Same as is_dir(), using the index and the filter of the archive when they are set.
+ */
+int tar_is_dir(const tar_archive_t *archive, const char *path);
+
+/**
+ * Same as is_file(), using the index and the filter of the archive when they are set.
+ */
+int tar_is_file(const tar_archive_t *archive, const char *path);
+
+/**
+ * Same as is_symlink(), using the index and the filter of the archive when they are set.
+ */
+int tar_is_symlink(const tar_archive_t *archive, const char *path);
+
+/**
+ * Same as list(), using the index and the filter of the archive when they are set.
+ */
+int tar_list(const tar_archive_t *archive, const char *path, char **entries, size_t *no_entries);
+
+/**
+ * Same as read_file(), using the index and the filter of the archive when they are set.
+ * The offset is 64-bit whatever the size of size_t.
+ * As with tar_read_entry(), the positive value returned is clamped to SSIZE_MAX.
+ */
+ssize_t tar_read_file(const tar_archive_t *archive, const char *path, uint64_t offset, uint8_t *dest, size_t *len);
+
+/**
+ * Callback invoked by tar_grep() for each match.
+ * Calls are serialized, the callback never runs concurrently with itself.
+ *
+ * @param path The path of the member in which the match was found.
+ * @param offset The offset of the match from the start of the member data.
+ * @param pattern The index in `patterns` of the pattern that matched.
+ * @param arg The `arg` value given to tar_grep().
+ *
+ * @return zero to continue the search, any other value to stop it.
+ */
+typedef int (*tar_grep_cb)(const char *path, uint64_t offset, size_t pattern, void *arg);
+
+/**
+ * Searches the data of every regular file in the archive for one or more patterns.
+ *
+ * The members are taken from the index of the archive when it is set, otherwise the headers are
+ * scanned once. They are then shared between worker threads which stream their data with
+ * positioned reads, so the file offset of the archive descriptor is left untouched.
+ * Matches within a member are reported in increasing offset order for each pattern,
+ * members are not reported in any particular order.
+ *
+ * @param archive The archive to search, its filter is not used.
+ * @param patterns An array of non-empty byte strings to search for.
+ * @param no_patterns The number of entries in `patterns`.
+ * @param filter NULL to search every file,
+ *               a glob (see fnmatch(3)) if it contains any of '*', '?' or '[',
+ *               a path prefix otherwise.
+ * @param cb The callback to report matches to.
+ * @param arg An opaque value given back to `cb`.
+ * @param no_threads The number of worker threads, zero or a negative value to use one per online CPU.
+ *
+ * @return the number of matches reported,
+ *         -1 if the arguments are invalid or an error occurred while reading the archive.
+ */
+ssize_t tar_grep(const tar_archive_t *archive, const char **patterns, size_t no_patterns, const char *filter,
+                 tar_grep_cb cb, void *arg, int no_threads);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,324 @@
+#ifndef LIB_TAR_HPP
+#define LIB_TAR_HPP
+
+#include "lib_tar.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <fcntl.h>
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+
+/*
+ * Header-only C++17 layer over lib_tar.h.
+ *
+ * A tar::Archive owns a file descriptor and the index of the archive, so lookups are binary
+ * searches, list() walks the matching slice of the index lazily and read_file() reads straight into the caller's buffer.
+ * No call allocates memory once the archive is open.
+ */
+namespace tar {
+
+// Byte offsets of the header fields
+namespace offsets {
+constexpr std::size_t name = 0;
+constexpr std::size_t mode = 100;
+constexpr std::size_t uid = 108;
+constexpr std::size_t gid = 116;
+constexpr std::size_t size = 124;
+constexpr std::size_t mtime = 136;
+constexpr std::size_t chksum = 148;
+constexpr std::size_t typeflag = 156;
+constexpr std::size_t linkname = 157;
+constexpr std::size_t magic = 257;
+constexpr std::size_t version = 263;
+constexpr std::size_t uname = 265;
+constexpr std::size_t gname = 297;
+constexpr std::size_t devmajor = 329;
+constexpr std::size_t devminor = 337;
+constexpr std::size_t prefix = 345;
+constexpr std::size_t padding = 500;
+constexpr std::size_t block = 512;
+}
+
+static_assert(offsetof(tar_header_t, name) == offsets::name);
+static_assert(offsetof(tar_header_t, mode) == offsets::mode);
+static_assert(offsetof(tar_header_t, uid) == offsets::uid);
+static_assert(offsetof(tar_header_t, gid) == offsets::gid);
+static_assert(offsetof(tar_header_t, size) == offsets::size);
+static_assert(offsetof(tar_header_t, mtime) == offsets::mtime);
+static_assert(offsetof(tar_header_t, chksum) == offsets::chksum);
+static_assert(offsetof(tar_header_t, typeflag) == offsets::typeflag);
+static_assert(offsetof(tar_header_t, linkname) == offsets::linkname);
+static_assert(offsetof(tar_header_t, magic) == offsets::magic);
+static_assert(offsetof(tar_header_t, version) == offsets::version);
+static_assert(offsetof(tar_header_t, uname) == offsets::uname);
+static_assert(offsetof(tar_header_t, gname) == offsets::gname);
+static_assert(offsetof(tar_header_t, devmajor) == offsets::devmajor);
+static_assert(offsetof(tar_header_t, devminor) == offsets::devminor);
+static_assert(offsetof(tar_header_t, prefix) == offsets::prefix);
+static_assert(offsetof(tar_header_t, padding) == offsets::padding);
+static_assert(sizeof(tar_header_t) == offsets::block);
+
+#if defined(__cpp_lib_span)
+using byte_span = std::span<std::uint8_t>;
+#else
+// Stand-in for std::span<std::uint8_t> before C++20
+class byte_span {
+public:
+    constexpr byte_span() noexcept = default;
+    constexpr byte_span(std::uint8_t *data, std::size_t size) noexcept : data_(data), size_(size) {}
+    template <class Container, class = decltype(std::data(std::declval<Container &>()))>
+    constexpr byte_span(Container &container) noexcept : data_(std::data(container)), size_(std::size(container)) {}
+
+    constexpr std::uint8_t *data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+
+private:
+    std::uint8_t *data_ = nullptr;
+    std::size_t size_ = 0;
+};
+#endif
+
+inline std::string_view path_of(const tar_entry_t &entry) noexcept {
+    return std::string_view(entry.path, entry.path_len);
+}
+
+/*
+ * Whether an entry under a directory prefix of dir_len bytes is listed at that directory:
+ * direct children, and entries of a directory one level down when they are directories themselves.
+ */
+inline bool is_child(const tar_entry_t &entry, std::size_t dir_len) noexcept {
+    std::string_view path = path_of(entry);
+    if (path.size() <= dir_len) {
+        return false;
+    }
+    std::size_t slashes = 0;
+    for (std::size_t i = dir_len + 1; i < path.size(); i++) {
+        slashes += path[i] == '/';
+    }
+    return slashes == 0 || (slashes == 1 && entry.typeflag == DIRTYPE);
+}
+
+/*
+ * The entries listed at a directory, as views into the index of the archive, in path order.
+ * The entries under the directory are found by binary search in the index, only those are
+ * walked to keep the children, following the rules of list() in lib_tar.h.
+ */
+class ListRange {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::string_view *;
+        using reference = std::string_view;
+
+        iterator() noexcept = default;
+
+        std::string_view operator*() const noexcept { return path_of(**cur_); }
+
+        iterator &operator++() noexcept {
+            ++cur_;
+            skip();
+            return *this;
+        }
+
+        iterator operator++(int) noexcept {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const iterator &other) const noexcept { return cur_ == other.cur_; }
+        bool operator!=(const iterator &other) const noexcept { return cur_ != other.cur_; }
+
+    private:
+        friend class ListRange;
+
+        // Holds copies of what it needs, so that it outlives the range it came from like the index does
+        iterator(tar_entry_t *const *cur, tar_entry_t *const *end, std::size_t dir_len) noexcept
+            : cur_(cur), end_(end), dir_len_(dir_len) { skip(); }
+
+        void skip() noexcept {
+            while (cur_ != end_ && !is_child(**cur_, dir_len_)) {
+                ++cur_;
+            }
+        }
+
+        tar_entry_t *const *cur_ = nullptr;
+        tar_entry_t *const *end_ = nullptr;
+        std::size_t dir_len_ = 0;
+    };
+
+    ListRange() noexcept = default;
+
+    iterator begin() const noexcept { return iterator(begin_, end_, dir_len()); }
+    iterator end() const noexcept { return iterator(end_, end_, dir_len()); }
+    bool empty() const noexcept { return begin() == end(); }
+
+private:
+    friend class Archive;
+
+    // Narrows the path-sorted entries down to those starting with the directory prefix
+    ListRange(tar_entry_t *const *sorted, std::size_t count, std::string_view dir, bool add_slash) noexcept
+        : dir_(dir), add_slash_(add_slash) {
+        tar_entry_t *const *last = sorted + count;
+        begin_ = std::partition_point(sorted, last, [this](const tar_entry_t *entry) {
+            return prefix_cmp(path_of(*entry)) < 0;
+        });
+        end_ = std::partition_point(begin_, last, [this](const tar_entry_t *entry) {
+            return prefix_cmp(path_of(*entry)) == 0;
+        });
+    }
+
+    // Compares the start of a path with the directory prefix, dir_ followed by '/' if add_slash_
+    int prefix_cmp(std::string_view path) const noexcept {
+        int cmp = path.substr(0, dir_.size()).compare(dir_);
+        if (cmp != 0 || !add_slash_) {
+            return cmp;
+        }
+        if (path.size() == dir_.size()) {
+            return -1;
+        }
+        unsigned char next = static_cast<unsigned char>(path[dir_.size()]);
+        return next < '/' ? -1 : next > '/' ? 1 : 0;
+    }
+
+    std::size_t dir_len() const noexcept { return dir_.size() + (add_slash_ ? 1 : 0); }
+
+    tar_entry_t *const *begin_ = nullptr;
+    tar_entry_t *const *end_ = nullptr;
+    std::string_view dir_;
+    bool add_slash_ = false;
+};
+
+/*
+ * An open archive and its index. Move-only, the descriptor and the index are released on destruction.
+ */
+class Archive {
+public:
+    // Opens the archive at the given path and indexes it, throws std::system_error on failure
+    explicit Archive(const char *path) : Archive(::open(path, O_RDONLY | O_CLOEXEC)) {}
+
+    // Takes ownership of an open archive descriptor and indexes it, throws std::system_error on failure
+    explicit Archive(int fd) : fd_(fd) {
+        if (fd_ < 0) {
+            throw std::system_error(errno, std::generic_category(), "open");
+        }
+        if (tar_index_build(fd_, &index_) != 0) {
+            ::close(fd_);
+            throw std::system_error(std::make_error_code(std::errc::io_error), "tar_index_build");
+        }
+    }
+
+    Archive(const Archive &) = delete;
+    Archive &operator=(const Archive &) = delete;
+
+    Archive(Archive &&other) noexcept
+        : fd_(std::exchange(other.fd_, -1)), index_(std::exchange(other.index_, tar_index_t{})) {}
+
+    Archive &operator=(Archive &&other) noexcept {
+        if (this != &other) {
+            release();
+            fd_ = std::exchange(other.fd_, -1);
+            index_ = std::exchange(other.index_, tar_index_t{});
+        }
+        return *this;
+    }
+
+    ~Archive() { release(); }
+
+    int fd() const noexcept { return fd_; }
+    const tar_index_t &index() const noexcept { return index_; }
+
+    // Returns the first entry at the given path, nullptr if there is none
+    const tar_entry_t *find(std::string_view path) const noexcept {
+        return tar_index_find(&index_, path.data(), path.size());
+    }
+
+    bool exists(std::string_view path) const noexcept { return find(path) != nullptr; }
+    bool is_dir(std::string_view path) const noexcept { return is_type(path, DIRTYPE); }
+    bool is_file(std::string_view path) const noexcept { return is_type(path, REGTYPE); }
+    bool is_symlink(std::string_view path) const noexcept { return is_type(path, SYMTYPE); }
+
+    /*
+     * Lists the entries at a given path, see list() in lib_tar.h.
+     * Symlinks are followed by their link name, which needs no entry of its own:
+     * a link to a directory stores "dir" while the directory entry, if any, is "dir/".
+     */
+    ListRange list(std::string_view path) const noexcept {
+        for (int i = 0;; i++) {
+            const tar_entry_t *link = find(path);
+            if (link == nullptr || link->typeflag != SYMTYPE) {
+                break;
+            }
+            if (i == max_links) {
+                return ListRange();
+            }
+            path = std::string_view(link->linkname);
+        }
+        bool add_slash = path.empty() || path.back() != '/';
+        return ListRange(index_.by_path, index_.no_entries, path, add_slash);
+    }
+
+    /*
+     * Reads a file at a given path, resolving symlinks, see read_file() in lib_tar.h.
+     * `len` is set to the number of bytes written to dest.
+     */
+    ssize_t read_file(std::string_view path, std::uint64_t offset, byte_span dest, std::size_t &len) const noexcept {
+        len = 0;
+        const tar_entry_t *entry = resolve(find(path));
+        if (entry == nullptr || entry->typeflag != REGTYPE || dest.size() == 0) {
+            return -1;
+        }
+        std::size_t read = dest.size();
+        ssize_t ret = tar_read_entry(fd_, entry, offset, dest.data(), &read);
+        if (ret >= 0) {
+            len = read;
+        }
+        return ret;
+    }
+
+private:
+    // Bounds the number of symlinks followed, like SYMLOOP_MAX
+    static constexpr int max_links = 40;
+
+    bool is_type(std::string_view path, char type) const noexcept {
+        const tar_entry_t *entry = find(path);
+        return entry != nullptr && entry->typeflag == type;
+    }
+
+    const tar_entry_t *resolve(const tar_entry_t *entry) const noexcept {
+        for (int i = 0; entry != nullptr && entry->typeflag == SYMTYPE; i++) {
+            if (i == max_links) {
+                return nullptr;
+            }
+            entry = find(entry->linkname);
+        }
+        return entry;
+    }
+
+    void release() noexcept {
+        if (fd_ >= 0) {
+            tar_index_free(&index_);
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    int fd_ = -1;
+    tar_index_t index_{};
+};
+
+}
+
+#endif